@@ -0,0 +1,526 @@
+#ifndef LSM_MAP_HPP
+#define LSM_MAP_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Map.hpp"
+
+namespace cs540 {
+// Write buffer in front of immutable sorted run files in a directory.
+// Writes go to an in-memory Map; once it holds max_entries entries or
+// about max_bytes of keys and values, it is streamed in order into a new
+// run file, made of blocks with a sparse index of their first keys, and
+// an empty Map takes over. Reads merge the Map with every run, newest
+// first; compact() merges all runs into one.
+// Keys and values are written with cs540::Serializer. Writes still in
+// the Map are lost unless flush() is called before destruction.
+template <typename K, typename M>
+class LsmMap {
+    static_assert(std::is_default_constructible<M>::value,
+                  "Mapped type must be default constructible");
+
+    using _Key = std::remove_const_t<K>;
+    using _KeySerializer = Serializer<_Key>;
+    using _MappedSerializer = Serializer<std::remove_const_t<M>>;
+
+    // A value, or a tombstone hiding older runs' values.
+    struct _Entry {
+        bool live;
+        M value;
+    };
+    using _Memtable = Map<K, _Entry>;
+
+    static constexpr char _MAGIC[8] = {'c', 's', '5', '4', '0', 'r', 'u', 'n'};
+    static constexpr std::uint32_t _FORMAT = 1;
+    static constexpr std::size_t _BLOCK_SIZE = 4096;
+
+    struct _Header {
+        char magic[8];
+        std::uint32_t format, key_size, mapped_size, reserved;
+    };
+
+    struct _Footer {
+        std::uint64_t index, blocks, size;
+        char magic[8];
+    };
+
+    struct _Block {
+        _Key first;
+        std::uint64_t offset, ordinal;
+    };
+
+    static std::pair<_Key, _Entry> _read_entry(std::istream &in) {
+        auto key = _KeySerializer::load(in);
+        auto live = in.get();
+        if (live == std::char_traits<char>::eof()) {
+            throw std::runtime_error{"Truncated run"};
+        }
+        return {std::move(key),
+                live ? _Entry{true, _MappedSerializer::load(in)} : _Entry{false, M{}}};
+    }
+
+    // Immutable run file, mapped read-only, with its sparse index.
+    class _Run {
+        std::string _path;
+        const char *_data;
+        std::size_t _size;
+        std::vector<_Block> _blocks;
+        std::uint64_t _entries;
+
+    public:
+        explicit _Run(std::string path) :
+            _path{std::move(path)}, _data{}, _size{}, _blocks{}, _entries{} {
+            auto fd = ::open(_path.c_str(), O_RDONLY);
+            struct stat status;
+            if (fd < 0 || ::fstat(fd, &status) < 0) {
+                auto error = errno;
+                if (fd >= 0) ::close(fd);
+                throw std::system_error{error, std::generic_category(), _path};
+            }
+            _size = static_cast<std::size_t>(status.st_size);
+            auto data = _size >= sizeof(_Header) + sizeof(_Footer)
+                ? ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0)
+                : MAP_FAILED;
+            ::close(fd);
+            if (data == MAP_FAILED) {
+                throw std::runtime_error{"Not a run: " + _path};
+            }
+            _data = static_cast<const char *>(data);
+
+            auto &header = *reinterpret_cast<const _Header *>(_data);
+            _Footer footer;
+            std::copy_n(_data + _size - sizeof(footer), sizeof(footer),
+                        reinterpret_cast<char *>(&footer));
+            if (!std::equal(std::begin(_MAGIC), std::end(_MAGIC), header.magic)
+                || !std::equal(std::begin(_MAGIC), std::end(_MAGIC), footer.magic)
+                || header.format != _FORMAT
+                || header.key_size != sizeof(K) || header.mapped_size != sizeof(M)
+                || footer.index >= _size) {
+                ::munmap(data, _size);
+                throw std::runtime_error{"Not a run: " + _path};
+            }
+            _entries = footer.size;
+
+            MemoryBuf buf{_data + footer.index, _size - sizeof(footer) - footer.index};
+            std::istream in{&buf};
+            _blocks.reserve(footer.blocks);
+            for (std::uint64_t i = 0; i < footer.blocks; ++i) {
+                auto first = _KeySerializer::load(in);
+                auto offset = Serializer<std::uint64_t>::load(in);
+                auto ordinal = Serializer<std::uint64_t>::load(in);
+                _blocks.push_back({std::move(first), offset, ordinal});
+            }
+        }
+
+        _Run(const _Run &) = delete;
+        _Run &operator=(const _Run &) = delete;
+
+        ~_Run() {
+            ::munmap(const_cast<char *>(_data), _size);
+        }
+
+        const std::string &path() const {
+            return _path;
+        }
+
+        std::uint64_t size() const {
+            return _entries;
+        }
+
+        // The block that would hold key, or the first one if key precedes them all.
+        const _Block *block_for(const K &key) const {
+            auto block = std::upper_bound(
+                _blocks.begin(), _blocks.end(), key, [] (const K &key, auto &block) {
+                    return key < block.first;
+                });
+            if (block == _blocks.begin()) {
+                return first_block();
+            }
+            return &*(block - 1);
+        }
+
+        const _Block *first_block() const {
+            return _blocks.empty() ? nullptr : &_blocks.front();
+        }
+
+        // Reads entries starting at a block, through to the end of the run.
+        MemoryBuf buffer(const _Block &block) const {
+            return {_data + block.offset, _size - block.offset};
+        }
+
+        // Number of entries from the block through to the end of the run.
+        std::uint64_t remaining(const _Block &block) const {
+            return _entries - block.ordinal;
+        }
+
+        std::uint64_t in_block(const _Block &block) const {
+            auto next = &block + 1;
+            return (next == _blocks.data() + _blocks.size() ? _entries : next->ordinal)
+                - block.ordinal;
+        }
+    }; // class _Run
+
+    // Streams entries in order into a new run file.
+    class _RunWriter {
+        std::string _path, _temp_path;
+        std::ofstream _out;
+        std::vector<_Block> _blocks;
+        std::uint64_t _entries, _block_start;
+
+    public:
+        explicit _RunWriter(std::string path) :
+            _path{std::move(path)}, _temp_path{_path + ".tmp"},
+            _out{_temp_path, std::ios::binary | std::ios::trunc},
+            _blocks{}, _entries{}, _block_start{} {
+            _Header header{{}, _FORMAT, sizeof(K), sizeof(M), 0};
+            std::copy(std::begin(_MAGIC), std::end(_MAGIC), header.magic);
+            _out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        }
+
+        void add(const K &key, const _Entry &entry) {
+            std::uint64_t offset = _out.tellp();
+            if (_blocks.empty() || offset - _block_start >= _BLOCK_SIZE) {
+                _blocks.push_back({key, offset, _entries});
+                _block_start = offset;
+            }
+            _KeySerializer::save(_out, key);
+            _out.put(entry.live);
+            if (entry.live) {
+                _MappedSerializer::save(_out, entry.value);
+            }
+            ++_entries;
+        }
+
+        // Writes the index and footer, then moves the file into place.
+        void finish() {
+            _Footer footer{static_cast<std::uint64_t>(_out.tellp()), _blocks.size(), _entries, {}};
+            std::copy(std::begin(_MAGIC), std::end(_MAGIC), footer.magic);
+            for (auto &block : _blocks) {
+                _KeySerializer::save(_out, block.first);
+                Serializer<std::uint64_t>::save(_out, block.offset);
+                Serializer<std::uint64_t>::save(_out, block.ordinal);
+            }
+            _out.write(reinterpret_cast<const char *>(&footer), sizeof(footer));
+            _out.close();
+            if (!_out || std::rename(_temp_path.c_str(), _path.c_str()) != 0) {
+                auto error = errno;
+                std::remove(_temp_path.c_str());
+                throw std::system_error{error, std::generic_category(), _path};
+            }
+        }
+    }; // class _RunWriter
+
+    std::string _directory;
+    std::size_t _max_entries, _max_bytes;
+    std::unique_ptr<_Memtable> _memtable;
+    // Oldest first.
+    std::vector<std::unique_ptr<_Run>> _runs;
+    std::uint64_t _next_run;
+
+    std::string _run_path(std::uint64_t number) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.run",
+                      static_cast<unsigned long long>(number));
+        return _directory + name;
+    }
+
+    void _write(const K &key, _Entry entry) {
+        auto &memtable = *_memtable;
+        auto result = memtable.insert({key, entry});
+        if (!result.second) {
+            result.first->second = std::move(entry);
+        }
+        if (memtable.size() >= _max_entries
+            || memtable.size() * (sizeof(K) + sizeof(M)) >= _max_bytes) {
+            flush();
+        }
+    }
+
+    // Merges the memtable, if asked, with every run, newest source first.
+    class _Merge {
+        struct _RunCursor {
+            std::unique_ptr<MemoryBuf> buf;
+            std::unique_ptr<std::istream> in;
+            std::uint64_t remaining;
+            std::unique_ptr<std::pair<_Key, _Entry>> current;
+
+            void advance() {
+                if (remaining == 0) {
+                    current.reset();
+                } else {
+                    --remaining;
+                    current = std::make_unique<std::pair<_Key, _Entry>>(_read_entry(*in));
+                }
+            }
+        };
+
+        typename _Memtable::ConstIterator _memtable, _memtable_end;
+        // Newest first.
+        std::vector<_RunCursor> _runs;
+        const K *_key;
+        const M *_value;
+
+        // Takes a copy, since key may live in a cursor being advanced.
+        void _advance_past(const _Key key) {
+            if (_memtable != _memtable_end && _memtable->first == key) {
+                ++_memtable;
+            }
+            for (auto &run : _runs) {
+                if (run.current && run.current->first == key) {
+                    run.advance();
+                }
+            }
+        }
+
+    public:
+        // Positions every source at the first key not less than seek, if given.
+        _Merge(const LsmMap &map, bool memtable, const K *seek) :
+            _memtable{}, _memtable_end{}, _runs{}, _key{}, _value{} {
+            if (memtable) {
+                _memtable = seek ? map._memtable->lower_bound(*seek) : map._memtable->begin();
+                _memtable_end = map._memtable->end();
+            }
+            for (auto run = map._runs.rbegin(); run != map._runs.rend(); ++run) {
+                auto block = seek ? (*run)->block_for(*seek) : (*run)->first_block();
+                if (!block) continue;
+                auto buf = std::make_unique<MemoryBuf>((*run)->buffer(*block));
+                auto in = std::make_unique<std::istream>(buf.get());
+                _runs.push_back({std::move(buf), std::move(in), (*run)->remaining(*block), {}});
+                auto &cursor = _runs.back();
+                cursor.advance();
+                for (; seek && cursor.current && cursor.current->first < *seek; cursor.advance());
+            }
+            settle();
+        }
+
+        // Moves to the smallest key left unless it is already live.
+        void settle() {
+            while (true) {
+                _key = _memtable == _memtable_end ? nullptr : &_memtable->first;
+                const _Entry *entry = _key ? &_memtable->second : nullptr;
+                for (auto &run : _runs) {
+                    if (run.current && (!_key || run.current->first < *_key)) {
+                        _key = &run.current->first;
+                        entry = &run.current->second;
+                    }
+                }
+                if (!_key) {
+                    _value = nullptr;
+                    return;
+                }
+                if (entry->live) {
+                    _value = &entry->value;
+                    return;
+                }
+                _advance_past(*_key);
+            }
+        }
+
+        void next() {
+            _advance_past(*_key);
+            settle();
+        }
+
+        const K *key() const {
+            return _key;
+        }
+
+        const M *value() const {
+            return _value;
+        }
+    }; // class _Merge
+
+public:
+    // Iterates the live entries of the memtable and every run in order.
+    // Copies of an iterator share their position.
+    class ConstIterator : public std::iterator<
+        std::input_iterator_tag,
+        std::pair<const K &, const M &>,
+        std::ptrdiff_t,
+        void,
+        std::pair<const K &, const M &>> {
+        std::shared_ptr<_Merge> _merge;
+
+        friend bool operator==(const ConstIterator &i1, const ConstIterator &i2) {
+            return i1.key() == i2.key();
+        }
+
+        friend bool operator!=(const ConstIterator &i1, const ConstIterator &i2) {
+            return !(i1 == i2);
+        }
+
+        explicit ConstIterator(std::shared_ptr<_Merge> merge) : _merge{std::move(merge)} {}
+
+        const K *key() const {
+            return _merge ? _merge->key() : nullptr;
+        }
+
+        friend class LsmMap;
+
+    public:
+        ConstIterator() : _merge{} {}
+
+        ConstIterator &operator++() {
+            _merge->next();
+            return *this;
+        }
+
+        std::pair<const K &, const M &> operator*() const {
+            return {*_merge->key(), *_merge->value()};
+        }
+    }; // class ConstIterator
+
+    explicit LsmMap(std::string directory,
+                    std::size_t max_entries = std::size_t{1} << 20,
+                    std::size_t max_bytes = std::size_t{64} << 20) :
+        _directory{std::move(directory)},
+        _max_entries{max_entries}, _max_bytes{max_bytes},
+        _memtable{std::make_unique<_Memtable>()}, _runs{}, _next_run{} {
+        if (::mkdir(_directory.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw std::system_error{errno, std::generic_category(), _directory};
+        }
+        auto dir = ::opendir(_directory.c_str());
+        if (!dir) {
+            throw std::system_error{errno, std::generic_category(), _directory};
+        }
+        std::vector<std::uint64_t> numbers;
+        while (auto entry = ::readdir(dir)) {
+            std::string name = entry->d_name;
+            unsigned long long number;
+            char suffix[8];
+            if (std::sscanf(name.c_str(), "%16llx.%7s", &number, suffix) == 2) {
+                if (std::string{suffix} == "run") {
+                    numbers.push_back(number);
+                } else if (std::string{suffix} == "run.tmp") {
+                    std::remove((_directory + "/" + name).c_str());
+                }
+            }
+        }
+        ::closedir(dir);
+        std::sort(numbers.begin(), numbers.end());
+        for (auto number : numbers) {
+            _runs.push_back(std::make_unique<_Run>(_run_path(number)));
+        }
+        _next_run = numbers.empty() ? 0 : numbers.back() + 1;
+    }
+
+    LsmMap(const LsmMap &) = delete;
+    LsmMap &operator=(const LsmMap &) = delete;
+
+    // Entries buffered in memory, tombstones included.
+    std::size_t memtable_size() const {
+        return _memtable->size();
+    }
+
+    std::size_t runs() const {
+        return _runs.size();
+    }
+
+    ConstIterator begin() const {
+        return ConstIterator{std::make_shared<_Merge>(*this, true, nullptr)};
+    }
+
+    ConstIterator end() const {
+        return {};
+    }
+
+    ConstIterator lower_bound(const K &key) const {
+        return ConstIterator{std::make_shared<_Merge>(*this, true, &key)};
+    }
+
+    M at(const K &key) const {
+        auto iter = _memtable->find(key);
+        if (iter != _memtable->end()) {
+            if (!iter->second.live) {
+                throw std::out_of_range{"Not found"};
+            }
+            return iter->second.value;
+        }
+        for (auto run = _runs.rbegin(); run != _runs.rend(); ++run) {
+            auto block = (*run)->block_for(key);
+            if (!block || key < block->first) continue;
+            auto buf = (*run)->buffer(*block);
+            std::istream in{&buf};
+            for (auto i = (*run)->in_block(*block); i > 0; --i) {
+                auto entry = _read_entry(in);
+                if (key < entry.first) break;
+                if (entry.first == key) {
+                    if (!entry.second.live) {
+                        throw std::out_of_range{"Not found"};
+                    }
+                    return std::move(entry.second.value);
+                }
+            }
+        }
+        throw std::out_of_range{"Not found"};
+    }
+
+    void assign(const K &key, M value) {
+        _write(key, _Entry{true, std::move(value)});
+    }
+
+    // Hides key from reads; it need not be present.
+    void erase(const K &key) {
+        _write(key, _Entry{false, M{}});
+    }
+
+    // Writes the memtable out as a new run and starts a fresh one.
+    void flush() {
+        if (_memtable->empty()) return;
+        auto path = _run_path(_next_run);
+        _RunWriter writer{path};
+        for (auto &value : *_memtable) {
+            writer.add(value.first, value.second);
+        }
+        writer.finish();
+        ++_next_run;
+        _runs.push_back(std::make_unique<_Run>(path));
+        _memtable = std::make_unique<_Memtable>();
+    }
+
+    // Merges every run into one, dropping tombstones and shadowed values.
+    void compact() {
+        if (_runs.size() < 2) return;
+        auto path = _run_path(_next_run);
+        {
+            _RunWriter writer{path};
+            for (_Merge merge{*this, false, nullptr}; merge.key(); merge.next()) {
+                writer.add(*merge.key(), _Entry{true, *merge.value()});
+            }
+            writer.finish();
+        }
+        ++_next_run;
+        for (auto &run : _runs) {
+            std::remove(run->path().c_str());
+        }
+        _runs.clear();
+        _runs.push_back(std::make_unique<_Run>(path));
+    }
+}; // template <typename, typename> class LsmMap
+
+template <typename K, typename M>
+constexpr char LsmMap<K, M>::_MAGIC[8];
+} // namespace cs540
+
+#endif // LSM_MAP_HPP
@@ -1,19 +1,35 @@
 #ifndef MAP_HPP
 #define MAP_HPP
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 
 #include <algorithm>
 #include <array>
+#include <fstream>
+#include <functional>
+#include <istream>
 #include <iterator>
+#include <map>
 #include <memory>
+#include <ostream>
 #include <random>
 #include <stdexcept>
+#include <streambuf>
 #include <string>
+#include <system_error>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace cs540 {
 namespace {
@@ -259,8 +275,52 @@ template <typename F, typename T, std::size_t N>
 auto map_array(const F &f, std::array<T, N> &xs) {
     return MapArrayImpl<std::make_index_sequence<N>>::call(f, xs);
 }
+// Reads a whole buffer, such as a file mapping, as a stream.
+struct MemoryBuf : std::streambuf {
+    MemoryBuf(const char *data, std::size_t size) {
+        auto begin = const_cast<char *>(data);
+        setg(begin, begin, begin + size);
+    }
+};
 } // anonymous namespace
 
+// How Map::save() and Map::load() write and read a key or mapped value.
+// Trivially copyable types are copied byte for byte in native byte order;
+// specialize this for anything else.
+template <typename T, typename = void>
+struct Serializer;
+
+template <typename T>
+struct Serializer<T, std::enable_if_t<std::is_trivially_copyable<T>::value>> {
+    static void save(std::ostream &out, const T &value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    static T load(std::istream &in) {
+        std::aligned_storage_t<sizeof(T), alignof(T)> space;
+        if (!in.read(reinterpret_cast<char *>(&space), sizeof(T))) {
+            throw std::runtime_error{"Truncated map"};
+        }
+        return *reinterpret_cast<T *>(&space);
+    }
+};
+
+template <>
+struct Serializer<std::string> {
+    static void save(std::ostream &out, const std::string &value) {
+        Serializer<std::uint64_t>::save(out, value.size());
+        out.write(value.data(), value.size());
+    }
+
+    static std::string load(std::istream &in) {
+        std::string value(Serializer<std::uint64_t>::load(in), '\0');
+        if (!in.read(&value[0], value.size())) {
+            throw std::runtime_error{"Truncated map"};
+        }
+        return value;
+    }
+};
+
 template <typename K, typename M>
 class Map {
 public:
@@ -296,6 +356,7 @@ private:
     public:
         constexpr _Iter() : _node{} {}
         constexpr _Iter(const _Iter<false> &that) : _node{that._node} {}
+        _Iter &operator=(const _Iter &) = default;
 
         _Iter &operator++() {
             _node = &_node->next();
@@ -370,6 +431,34 @@ private:
         }
     };
 
+    // Values as of a snapshot for the keys first written after it was taken,
+    // before the next snapshot; a null value means the key was absent.
+    // Older logs keep newer ones alive, since a snapshot reads through them.
+    struct _UndoLog {
+        std::map<K, std::unique_ptr<ValueType>> undone;
+        std::size_t size;
+        std::shared_ptr<_UndoLog> newer;
+
+        explicit _UndoLog(std::size_t size) : undone{}, size{size}, newer{} {}
+    };
+
+    // Nodes allocated together, freed once the last of them is erased.
+    struct _Slab {
+        std::unique_ptr<char[]> space;
+        std::size_t size, live;
+    };
+
+    // Header of the save() format, followed by one byte per tower height
+    // and then each key and mapped value in order.
+    struct _FileHeader {
+        char magic[8];
+        std::uint32_t format, key_size, mapped_size, height;
+        std::uint64_t size;
+    };
+    static constexpr char _FILE_MAGIC[8] = {'c', 's', '5', '4', '0', 'm', 'a', 'p'};
+    static constexpr std::uint32_t _FILE_FORMAT = 1;
+    static constexpr std::size_t _SLAB_SIZE = std::size_t{1} << 20;
+
     Node _sentinel;
     union {
         // _sentinel will assume it constructs these links.
@@ -378,6 +467,9 @@ private:
     DefaultOnMove<std::size_t> _size;
     std::default_random_engine _random;
     std::geometric_distribution<std::size_t> _height_generator;
+    std::weak_ptr<_UndoLog> _undo_log;
+    // Sorted by address.
+    std::vector<_Slab> _slabs;
 
     static Iterator _iter(Node &node) {
         return node;
@@ -423,7 +515,7 @@ private:
 
         Iterator begin = _sentinel.height() == 0 || &link_refs[0].get() == &_links[0]
             ? this->begin()
-            : Iterator {Node::from_link(link_refs[0], 0)};
+            : Iterator {Node::from_link(link_refs[0].get(), 0)};
         auto end = this->end();
         auto result = std::find_if_not(begin, end, [&] (auto &value) {
             return value.first < key;
@@ -434,12 +526,13 @@ private:
         return _SearchResult {result, link_refs};
     }
 
+    // Returns the first element not less than key, and whether it equals key.
     template <typename This>
-    static auto _find(This &&map, const K &key) {
+    static auto _find_lower_bound(This &&map, const K &key) {
         using Iter = decltype(map.begin());
 
         if (map.empty() || _iter(map._sentinel.prev())->first < key) {
-            return map.end();
+            return std::make_pair(map.end(), false);
         }
 
         Iter begin = map.begin();
@@ -453,54 +546,82 @@ private:
                     Iter iter{Node::from_link(link_ref.get().next(), i - 1)};
                     if (&link_ref.get().next() == &map._links[i - 1] || key < iter->first) break;
                     if (iter->first == key) {
-                        return iter;
+                        return std::make_pair(iter, true);
                     }
                     link_ref = std::ref(link_ref.get().next());
                 }
             }
             if (&link_ref.get() != &map._links[0]) {
-                begin = Iter {Node::from_link(link_ref, 0)};
+                begin = Iter {Node::from_link(link_ref.get(), 0)};
             }
         }
         auto end = map.end();
         auto result = std::find_if_not(begin, end, [&] (auto &value) {
             return value.first < key;
         });
-        return result != end && result->first == key
-            ? result : end;
+        return std::make_pair(result, result != end && result->first == key);
+    }
+
+    template <typename This>
+    static auto _find(This &&map, const K &key) {
+        auto result = _find_lower_bound(std::forward<This>(map), key);
+        return result.second ? result.first : map.end();
     }
 
     template <typename This>
     static auto &_at(This &&map, const K &key) {
-        auto iter = _find(std::forward<This>(map), key);
+        auto iter = map.find(key);
         if (iter == map.end()) {
             throw std::out_of_range{"Not found"};
         }
         return iter->second;
     }
 
-    template <typename V>
-    static auto &_new(V &&value, std::size_t height) {
+    static std::size_t _node_size(std::size_t height) {
         auto size = sizeof(_DereferenceableNode)
             + offsetof(_DereferenceableNodeWithLink, second)
             + height * sizeof(Link);
-        auto space = std::make_unique<char[]>(size);
-        auto result = new(space.get()) _DereferenceableNode {std::forward<V>(value), height};
+        auto align = alignof(_DereferenceableNodeWithLink);
+        return (size + align - 1) / align * align;
+    }
+
+    template <typename V>
+    static auto &_construct(char *space, V &&value, std::size_t height) {
+        return (new(space) _DereferenceableNode {std::forward<V>(value), height})->node;
+    }
+
+    template <typename V>
+    static auto &_new(V &&value, std::size_t height) {
+        auto space = std::make_unique<char[]>(_node_size(height));
+        auto &result = _construct(space.get(), std::forward<V>(value), height);
         space.release();
-        return result->node;
+        return result;
     }
 
-    template <typename LinkRefIter, typename V>
-    Iterator _insert_before(Iterator iter, LinkRefIter link_iter, V &&value) {
-        auto height = _height_generator(_random);
+    _Slab &_new_slab(std::size_t size) {
+        auto space = std::make_unique<char[]>(size);
+        auto slab = std::upper_bound(
+            _slabs.begin(), _slabs.end(), space.get(), [] (char *space, auto &slab) {
+                return std::less<char *>{}(space, slab.space.get());
+            });
+        return *_slabs.insert(slab, _Slab {std::move(space), size, 0});
+    }
 
-        auto &node = _new(std::forward<V>(value), height);
+    template <typename LinkRefIter>
+    Iterator _link_before(Iterator iter, LinkRefIter link_iter, Node &node) {
         iter.node().insert_before(node, link_iter);
         ++_size;
-        _sentinel.height() = std::max(_sentinel.height(), height);
+        _sentinel.height() = std::max(_sentinel.height(), node.height());
         return node;
     }
 
+    template <typename LinkRefIter, typename V>
+    Iterator _insert_before(Iterator iter, LinkRefIter link_iter, V &&value) {
+        _remember(value.first);
+        auto height = _height_generator(_random);
+        return _link_before(iter, link_iter, _new(std::forward<V>(value), height));
+    }
+
     template <typename V>
     auto _insert_at_end(V &&value) {
         return _insert_before(end(), _links.begin(), std::forward<V>(value));
@@ -510,7 +631,8 @@ private:
     M &_subscript(Key &&key) {
         static_assert(std::is_default_constructible<M>::value,
                       "Mapped type must be default constructible");
-        return _lower_bound(key).match([] (auto iter) {
+        return _lower_bound(key).match([this] (auto iter) {
+            this->_remember(iter->first, &*iter);
             return iter;
         }, [&, this] (auto iter, auto link_iter) {
             return this->_insert_before(
@@ -521,7 +643,8 @@ private:
 
     template <class V>
     std::pair<Iterator, bool> _insert(V &&value) {
-        return _lower_bound(value.first).match([] (auto iter) {
+        return _lower_bound(value.first).match([this] (auto iter) {
+            this->_remember(iter->first, &*iter);
             return std::make_pair(iter, false);
         }, [&, this] (auto iter, auto link_iter) {
             return std::make_pair(
@@ -530,18 +653,210 @@ private:
         });
     }
 
-    static void _delete(Node &&node) {
+    template <typename V>
+    void _remember(const K &, const V *, std::false_type) {}
+
+    template <typename V>
+    void _remember(const K &key, const V *value, std::true_type) {
+        auto log = _undo_log.lock();
+        if (!log) return;
+        auto &undone = log->undone;
+        auto iter = undone.lower_bound(key);
+        if (iter == undone.end() || key < iter->first) {
+            undone.emplace_hint(
+                iter, key, value ? std::make_unique<ValueType>(*value) : nullptr);
+        }
+    }
+
+    // Records the current value of key, if any, for the newest live snapshot.
+    void _remember(const K &key, const ValueType *value = nullptr) {
+        _remember(key, value, std::is_copy_constructible<ValueType>{});
+    }
+
+    void _delete(Node &&node) {
         auto &deref_node = *reinterpret_cast<_DereferenceableNode *>(
             reinterpret_cast<char *>(&node)
             - offsetof(_DereferenceableNode, node));
         deref_node.~_DereferenceableNode();
-        delete[] reinterpret_cast<char *>(&deref_node);
+        auto space = reinterpret_cast<char *>(&deref_node);
+        if (!_slabs.empty()) {
+            auto slab = std::upper_bound(
+                _slabs.begin(), _slabs.end(), space, [] (char *space, auto &slab) {
+                    return std::less<char *>{}(space, slab.space.get());
+                });
+            if (slab != _slabs.begin()
+                && std::less<char *>{}(space, (--slab)->space.get() + slab->size)) {
+                if (--slab->live == 0) {
+                    _slabs.erase(slab);
+                }
+                return;
+            }
+        }
+        delete[] space;
     }
 
 public:
+    // Read-only view of the map as of the moment snapshot() was called.
+    // Taking one is O(1); afterwards each key written through at(),
+    // operator[], find(), insert() or erase() has its old value copied once,
+    // so a snapshot costs memory proportional to the changes since.
+    // Writes through references or iterators obtained before the snapshot
+    // are not seen by it, and the map must outlive its snapshots.
+    class Snapshot {
+        using _Undone = decltype(_UndoLog::undone);
+
+        struct _Cursor {
+            typename _Undone::const_iterator iter, end;
+        };
+
+        const Map *_map;
+        std::shared_ptr<const _UndoLog> _log;
+
+        Snapshot(const Map &map, std::shared_ptr<const _UndoLog> log) :
+            _map{&map}, _log{std::move(log)} {}
+
+        friend class Map;
+
+    public:
+        class ConstIterator : public std::iterator<
+            std::forward_iterator_tag,
+            ValueType,
+            std::ptrdiff_t,
+            const ValueType *,
+            const ValueType &> {
+            typename Map::ConstIterator _live, _live_end;
+            std::vector<_Cursor> _cursors;
+            const ValueType *_value;
+
+            friend bool operator==(const ConstIterator &i1, const ConstIterator &i2) {
+                return i1._value == i2._value;
+            }
+
+            friend bool operator!=(const ConstIterator &i1, const ConstIterator &i2) {
+                return !(i1 == i2);
+            }
+
+            // Stops at the smallest key left in the map or any newer log,
+            // taking its value from the oldest log that recorded it.
+            void _settle() {
+                while (true) {
+                    const K *key = _live == _live_end ? nullptr : &_live->first;
+                    for (auto &cursor : _cursors) {
+                        if (cursor.iter != cursor.end
+                            && (!key || cursor.iter->first < *key)) {
+                            key = &cursor.iter->first;
+                        }
+                    }
+                    if (!key) {
+                        _value = nullptr;
+                        return;
+                    }
+
+                    auto recorded = std::find_if(
+                        _cursors.begin(), _cursors.end(), [&] (auto &cursor) {
+                            return cursor.iter != cursor.end && cursor.iter->first == *key;
+                        });
+                    if (recorded == _cursors.end()) {
+                        _value = &*_live;
+                        return;
+                    }
+                    if (recorded->iter->second) {
+                        _value = recorded->iter->second.get();
+                        return;
+                    }
+                    _advance(*key);
+                }
+            }
+
+            void _advance(const K &key) {
+                for (auto &cursor : _cursors) {
+                    if (cursor.iter != cursor.end && cursor.iter->first == key) {
+                        ++cursor.iter;
+                    }
+                }
+                if (_live != _live_end && _live->first == key) {
+                    ++_live;
+                }
+            }
+
+            template <typename Seek>
+            ConstIterator(const Snapshot &snapshot, Seek &&seek) :
+                _live{seek(*snapshot._map)}, _live_end{snapshot._map->end()},
+                _cursors{}, _value{} {
+                for (auto log = snapshot._log.get(); log; log = log->newer.get()) {
+                    _cursors.push_back({seek(log->undone), log->undone.end()});
+                }
+                _settle();
+            }
+
+            friend class Snapshot;
+
+        public:
+            ConstIterator() : _live{}, _live_end{}, _cursors{}, _value{} {}
+
+            ConstIterator &operator++() {
+                _advance(_value->first);
+                _settle();
+                return *this;
+            }
+
+            ConstIterator operator++(int) {
+                auto tmp = *this;
+                ++*this;
+                return tmp;
+            }
+
+            const ValueType &operator*() const {
+                return *_value;
+            }
+
+            const ValueType *operator->() const {
+                return _value;
+            }
+        }; // class ConstIterator
+
+        std::size_t size() const {
+            return _log->size;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        ConstIterator begin() const {
+            return {*this, [] (auto &xs) {
+                return xs.begin();
+            }};
+        }
+
+        ConstIterator end() const {
+            return {};
+        }
+
+        ConstIterator lower_bound(const K &key) const {
+            return {*this, [&] (auto &xs) {
+                return xs.lower_bound(key);
+            }};
+        }
+
+        ConstIterator find(const K &key) const {
+            auto iter = lower_bound(key);
+            return iter != end() && iter->first == key ? iter : end();
+        }
+
+        const M &at(const K &key) const {
+            auto iter = find(key);
+            if (iter == end()) {
+                throw std::out_of_range{"Not found"};
+            }
+            return iter->second;
+        }
+    }; // class Snapshot
+
     Map() :
         _sentinel{_MAX_HEIGHT}, _size{},
-        _random{std::random_device {}()}, _height_generator{} {
+        _random{std::random_device {}()}, _height_generator{}, _undo_log{},
+        _slabs{} {
         _sentinel.height() = 0;
     }
 
@@ -570,6 +885,7 @@ public:
     Map &operator=(Map &&that) = default;
 
     ~Map() {
+        _undo_log.reset();
         clear();
     }
 
@@ -606,13 +922,21 @@ public:
     }
 
     Iterator find(const K &key) {
-        return _find(*this, key);
+        auto iter = _find(*this, key);
+        if (iter != end()) {
+            _remember(iter->first, &*iter);
+        }
+        return iter;
     }
 
     ConstIterator find(const K &key) const {
         return _find(*this, key);
     }
 
+    ConstIterator lower_bound(const K &key) const {
+        return _find_lower_bound(*this, key).first;
+    }
+
     M &at(const K &key) {
         return _at(*this, key);
     }
@@ -645,6 +969,7 @@ public:
     }
 
     void erase(Iterator iter) {
+        _remember(iter->first, &*iter);
         auto &node = iter.node();
         node.disconnect();
         if (node.height() == _sentinel.height()) {
@@ -663,6 +988,138 @@ public:
         erase(iter);
     }
 
+    // Writes the map, tower heights included, in a versioned binary format.
+    template <typename KeySerializer = Serializer<std::remove_const_t<K>>,
+              typename MappedSerializer = Serializer<std::remove_const_t<M>>>
+    void save(std::ostream &out) const {
+        _FileHeader header{
+            {}, _FILE_FORMAT, sizeof(K), sizeof(M),
+            static_cast<std::uint32_t>(_sentinel.height()), size()};
+        std::copy(std::begin(_FILE_MAGIC), std::end(_FILE_MAGIC), header.magic);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (auto iter = begin(); iter != end(); ++iter) {
+            out.put(static_cast<char>(iter.node().height()));
+        }
+        for (auto &value : *this) {
+            KeySerializer::save(out, value.first);
+            MappedSerializer::save(out, value.second);
+        }
+        if (!out) {
+            throw std::runtime_error{"Could not write map"};
+        }
+    }
+
+    template <typename KeySerializer = Serializer<std::remove_const_t<K>>,
+              typename MappedSerializer = Serializer<std::remove_const_t<M>>>
+    void save(const std::string &path) const {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        save<KeySerializer, MappedSerializer>(out);
+        out.close();
+        if (!out) {
+            throw std::system_error{errno, std::generic_category(), path};
+        }
+    }
+
+    // Replaces the contents with a map written by save(), rebuilding the
+    // same towers in one pass over nodes allocated in large slabs.
+    template <typename KeySerializer = Serializer<std::remove_const_t<K>>,
+              typename MappedSerializer = Serializer<std::remove_const_t<M>>>
+    void load(std::istream &in) {
+        clear();
+        _FileHeader header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || !std::equal(std::begin(_FILE_MAGIC), std::end(_FILE_MAGIC), header.magic)
+            || header.format != _FILE_FORMAT
+            || header.key_size != sizeof(K) || header.mapped_size != sizeof(M)
+            || header.height > _MAX_HEIGHT) {
+            throw std::runtime_error{"Not a compatible map"};
+        }
+
+        std::vector<unsigned char> heights(header.size);
+        if (!in.read(reinterpret_cast<char *>(heights.data()), heights.size())) {
+            throw std::runtime_error{"Truncated map"};
+        }
+        if (std::any_of(heights.begin(), heights.end(), [&] (auto height) {
+            return height > header.height;
+        })) {
+            throw std::runtime_error{"Not a compatible map"};
+        }
+
+        try {
+            for (std::size_t i = 0; i < heights.size();) {
+                // Fill a slab with as many of the next nodes as fit.
+                auto j = i;
+                std::size_t slab_size = 0;
+                do {
+                    slab_size += _node_size(heights[j++]);
+                } while (j < heights.size()
+                         && slab_size + _node_size(heights[j]) <= _SLAB_SIZE);
+                auto &slab = _new_slab(slab_size);
+
+                for (auto space = slab.space.get(); i < j; ++i) {
+                    auto key = KeySerializer::load(in);
+                    if (!empty() && !(_iter(_sentinel.prev())->first < key)) {
+                        throw std::runtime_error{"Keys out of order"};
+                    }
+                    auto &node = _construct(
+                        space, ValueType{std::move(key), MappedSerializer::load(in)},
+                        heights[i]);
+                    ++slab.live;
+                    space += _node_size(heights[i]);
+                    _link_before(end(), _links.begin(), node);
+                }
+            }
+        } catch (...) {
+            clear();
+            _slabs.clear();
+            throw;
+        }
+    }
+
+    // Loads straight out of a read-only mapping of the file.
+    template <typename KeySerializer = Serializer<std::remove_const_t<K>>,
+              typename MappedSerializer = Serializer<std::remove_const_t<M>>>
+    void load(const std::string &path) {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || ::fstat(fd, &status) < 0) {
+            auto error = errno;
+            if (fd >= 0) ::close(fd);
+            throw std::system_error{error, std::generic_category(), path};
+        }
+        auto size = static_cast<std::size_t>(status.st_size);
+        auto data = size > 0
+            ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+        auto error = errno;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::system_error{size > 0 ? error : EINVAL, std::generic_category(), path};
+        }
+        ::madvise(data, size, MADV_SEQUENTIAL);
+
+        MemoryBuf buf{static_cast<const char *>(data), size};
+        std::istream in{&buf};
+        try {
+            load<KeySerializer, MappedSerializer>(in);
+        } catch (...) {
+            ::munmap(data, size);
+            throw;
+        }
+        ::munmap(data, size);
+    }
+
+    Snapshot snapshot() {
+        static_assert(std::is_copy_constructible<ValueType>::value,
+                      "Value type must be copy constructible");
+        auto log = std::make_shared<_UndoLog>(size());
+        if (auto newest = _undo_log.lock()) {
+            newest->newer = log;
+        }
+        _undo_log = log;
+        return {*this, std::move(log)};
+    }
+
     void clear() {
         while (!empty()) {
             erase(begin());
@@ -670,6 +1127,9 @@ public:
     }
 }; // template <typename, typename> class Map
 
+template <typename K, typename M>
+constexpr char Map<K, M>::_FILE_MAGIC[8];
+
 template <typename K, typename M>
 static bool operator==(const Map<K, M> &m1, const Map<K, M> &m2) {
     return m1.size() == m2.size() && std::equal(m1.begin(), m1.end(), m2.begin());
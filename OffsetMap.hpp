@@ -0,0 +1,391 @@
+#ifndef OFFSET_MAP_HPP
+#define OFFSET_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace cs540 {
+// Skip list living entirely inside a caller-supplied region of memory,
+// linked by offsets from the start of the region instead of pointers.
+// The region can be a file mapping or shared memory, and can be reopened
+// at another address, in another process, with no fixups; a prebuilt map
+// can be mapped read-only and searched immediately.
+// Keys and mapped values are stored as is, so they must be trivially
+// copyable. Writers in different processes must serialize themselves.
+template <typename K, typename M>
+class OffsetMap {
+    static_assert(std::is_trivially_copyable<K>::value,
+                  "Key type must be trivially copyable");
+    static_assert(std::is_trivially_copyable<M>::value,
+                  "Mapped type must be trivially copyable");
+
+public:
+    using ValueType = std::pair<const K, M>;
+
+private:
+    using _Offset = std::uint64_t;
+
+    static constexpr std::size_t _MAX_HEIGHT = 32;
+    static constexpr char _MAGIC[8] = {'c', 's', '5', '4', '0', 'o', 'f', 'f'};
+    static constexpr std::uint32_t _FORMAT = 1;
+
+    // Lives at offset 0, so a zero offset doubles as the end of a list.
+    struct _Header {
+        char magic[8];
+        std::uint32_t format, key_size, mapped_size, height;
+        std::uint64_t size, capacity, top, random;
+        std::array<_Offset, _MAX_HEIGHT> next;
+        _Offset last;
+        // Erased nodes, by height, for reuse.
+        std::array<_Offset, _MAX_HEIGHT + 1> free;
+    };
+
+    // Followed by height offsets to the next node at each level.
+    struct _Node {
+        ValueType value;
+        _Offset prev;
+        std::uint64_t height;
+    };
+
+    static constexpr std::size_t _ALIGN = alignof(std::max_align_t);
+
+    char *_base;
+
+    template <bool Const>
+    class _Iter : public std::iterator<
+        std::bidirectional_iterator_tag,
+        ValueType,
+        std::ptrdiff_t,
+        std::conditional_t<Const, const ValueType, ValueType> *,
+        std::conditional_t<Const, const ValueType, ValueType> &> {
+        const OffsetMap *_map;
+        _Offset _offset;
+
+        friend constexpr bool operator==(const _Iter &i1, const _Iter &i2) {
+            return i1._offset == i2._offset;
+        }
+
+        friend constexpr bool operator!=(const _Iter &i1, const _Iter &i2) {
+            return !(i1 == i2);
+        }
+
+        constexpr _Iter(const OffsetMap &map, _Offset offset) :
+            _map{&map}, _offset{offset} {}
+
+        friend class OffsetMap;
+        friend class _Iter<!Const>;
+
+    public:
+        constexpr _Iter() : _map{}, _offset{} {}
+        constexpr _Iter(const _Iter<false> &that) : _map{that._map}, _offset{that._offset} {}
+        _Iter &operator=(const _Iter &) = default;
+
+        _Iter &operator++() {
+            _offset = _map->_next(_offset, 0);
+            return *this;
+        }
+
+        _Iter operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        _Iter &operator--() {
+            _offset = _offset ? _map->_node(_offset).prev : _map->_header().last;
+            return *this;
+        }
+
+        _Iter operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        std::conditional_t<Const, const ValueType, ValueType> &operator*() const {
+            return _map->_node(_offset).value;
+        }
+
+        std::conditional_t<Const, const ValueType, ValueType> *operator->() const {
+            return &**this;
+        }
+    }; // template <bool> class _Iter
+
+public:
+    using Iterator = _Iter<false>;
+    using ConstIterator = _Iter<true>;
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+private:
+    explicit OffsetMap(char *base) : _base{base} {}
+
+    _Header &_header() const {
+        return *reinterpret_cast<_Header *>(_base);
+    }
+
+    _Node &_node(_Offset offset) const {
+        return *reinterpret_cast<_Node *>(_base + offset);
+    }
+
+    static std::size_t _node_size(std::size_t height) {
+        auto size = sizeof(_Node) + height * sizeof(_Offset);
+        return (size + _ALIGN - 1) / _ALIGN * _ALIGN;
+    }
+
+    // The header's links stand in for a tower at offset 0.
+    _Offset &_next(_Offset offset, std::size_t i) const {
+        return offset
+            ? reinterpret_cast<_Offset *>(&_node(offset) + 1)[i]
+            : _header().next[i];
+    }
+
+    std::size_t _random_height() const {
+        auto &x = _header().random;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        auto height = std::size_t{1};
+        for (auto bits = x; height < _MAX_HEIGHT && (bits & 1); bits >>= 1, ++height);
+        return height;
+    }
+
+    _Offset _allocate(std::size_t height) const {
+        auto &header = _header();
+        if (auto offset = header.free[height]) {
+            header.free[height] = _next(offset, 0);
+            return offset;
+        }
+        auto size = _node_size(height);
+        if (header.capacity - header.top < size) {
+            throw std::bad_alloc{};
+        }
+        auto offset = header.top;
+        header.top += size;
+        return offset;
+    }
+
+    // Fills preds with the last node before key at each level,
+    // and returns the first node not less than key.
+    _Offset _search(const K &key, std::array<_Offset, _MAX_HEIGHT> *preds) const {
+        _Offset pred = 0;
+        for (auto i = _header().height; i > 0; --i) {
+            for (_Offset next; (next = _next(pred, i - 1)) && _node(next).value.first < key;
+                pred = next);
+            if (preds) {
+                (*preds)[i - 1] = pred;
+            }
+        }
+        return _next(pred, 0);
+    }
+
+    template <typename This>
+    static auto _find(This &&map, const K &key) {
+        auto offset = map._search(key, nullptr);
+        using Iter = decltype(map.begin());
+        return offset && map._node(offset).value.first == key
+            ? Iter{map, offset}
+            : map.end();
+    }
+
+    template <typename This>
+    static auto &_at(This &&map, const K &key) {
+        auto iter = _find(std::forward<This>(map), key);
+        if (iter == map.end()) {
+            throw std::out_of_range{"Not found"};
+        }
+        return iter->second;
+    }
+
+    Iterator _insert_before(_Offset next, const std::array<_Offset, _MAX_HEIGHT> &preds,
+                            const ValueType &value) {
+        auto &header = _header();
+        auto height = _random_height();
+        auto offset = _allocate(height);
+        new(_base + offset) _Node{value, preds[0], height};
+        for (auto i = header.height; i < height; ++i) {
+            _next(offset, i) = _next(0, i);
+            _next(0, i) = offset;
+        }
+        for (std::size_t i = 0; i < std::min<std::size_t>(height, header.height); ++i) {
+            _next(offset, i) = _next(preds[i], i);
+            _next(preds[i], i) = offset;
+        }
+        (next ? _node(next).prev : header.last) = offset;
+        header.height = std::max<std::size_t>(header.height, height);
+        ++header.size;
+        return {*this, offset};
+    }
+
+    static const char *_validate(const void *region, std::size_t size) {
+        auto &header = *static_cast<const _Header *>(region);
+        if (reinterpret_cast<std::uintptr_t>(region) % _ALIGN != 0
+            || size < sizeof(_Header)
+            || !std::equal(std::begin(_MAGIC), std::end(_MAGIC), header.magic)
+            || header.format != _FORMAT
+            || header.key_size != sizeof(K) || header.mapped_size != sizeof(M)
+            || header.capacity > size) {
+            throw std::invalid_argument{"Not a compatible map"};
+        }
+        return static_cast<const char *>(region);
+    }
+
+public:
+    // Lays out an empty map over the region, which must be aligned for
+    // any type and stay at least as large as it is now.
+    static OffsetMap create(void *region, std::size_t size) {
+        if (reinterpret_cast<std::uintptr_t>(region) % _ALIGN != 0) {
+            throw std::invalid_argument{"Misaligned region"};
+        }
+        if (size < _node_size(0) + sizeof(_Header)) {
+            throw std::bad_alloc{};
+        }
+        auto &header = *new(region) _Header{};
+        std::copy(std::begin(_MAGIC), std::end(_MAGIC), header.magic);
+        header.format = _FORMAT;
+        header.key_size = sizeof(K);
+        header.mapped_size = sizeof(M);
+        header.capacity = size;
+        header.top = (sizeof(_Header) + _ALIGN - 1) / _ALIGN * _ALIGN;
+        header.random = reinterpret_cast<std::uintptr_t>(region) | 1;
+        return OffsetMap{static_cast<char *>(region)};
+    }
+
+    // Attaches to a map made by create(), wherever the region now lives.
+    static OffsetMap open(void *region, std::size_t size) {
+        return OffsetMap{const_cast<char *>(_validate(region, size))};
+    }
+
+    // Attaches to a read-only region, such as a PROT_READ mapping.
+    static const OffsetMap open(const void *region, std::size_t size) {
+        return OffsetMap{const_cast<char *>(_validate(region, size))};
+    }
+
+public:
+    std::size_t size() const {
+        return _header().size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // Bytes of the region in use, including erased nodes kept for reuse.
+    std::size_t bytes_used() const {
+        return _header().top;
+    }
+
+    Iterator begin() {
+        return {*this, _next(0, 0)};
+    }
+
+    Iterator end() {
+        return {*this, 0};
+    }
+
+    ConstIterator begin() const {
+        return {*this, _next(0, 0)};
+    }
+
+    ConstIterator end() const {
+        return {*this, 0};
+    }
+
+    ReverseIterator rbegin() {
+        return std::make_reverse_iterator(end());
+    }
+
+    ReverseIterator rend() {
+        return std::make_reverse_iterator(begin());
+    }
+
+    Iterator find(const K &key) {
+        return _find(*this, key);
+    }
+
+    ConstIterator find(const K &key) const {
+        return _find(*this, key);
+    }
+
+    ConstIterator lower_bound(const K &key) const {
+        return {*this, _search(key, nullptr)};
+    }
+
+    M &at(const K &key) {
+        return _at(*this, key);
+    }
+
+    const M &at(const K &key) const {
+        return _at(*this, key);
+    }
+
+    M &operator[](const K &key) {
+        static_assert(std::is_default_constructible<M>::value,
+                      "Mapped type must be default constructible");
+        return insert({key, M{}}).first->second;
+    }
+
+    std::pair<Iterator, bool> insert(const ValueType &value) {
+        std::array<_Offset, _MAX_HEIGHT> preds{};
+        auto next = _search(value.first, &preds);
+        if (next && _node(next).value.first == value.first) {
+            return {{*this, next}, false};
+        }
+        return {_insert_before(next, preds, value), true};
+    }
+
+    void erase(Iterator iter) {
+        auto &header = _header();
+        auto offset = iter._offset;
+        auto &node = _node(offset);
+        std::array<_Offset, _MAX_HEIGHT> preds{};
+        _search(node.value.first, &preds);
+        for (std::size_t i = 0; i < node.height; ++i) {
+            _next(preds[i], i) = _next(offset, i);
+        }
+        auto next = _next(offset, 0);
+        (next ? _node(next).prev : header.last) = node.prev;
+        for (; header.height > 0 && !_next(0, header.height - 1); --header.height);
+        --header.size;
+
+        _next(offset, 0) = header.free[node.height];
+        header.free[node.height] = offset;
+    }
+
+    void erase(const K &key) {
+        auto iter = find(key);
+        if (iter == end()) {
+            throw std::out_of_range{"Not found"};
+        }
+        erase(iter);
+    }
+
+    void clear() {
+        while (!empty()) {
+            erase(begin());
+        }
+    }
+}; // template <typename, typename> class OffsetMap
+
+template <typename K, typename M>
+constexpr char OffsetMap<K, M>::_MAGIC[8];
+
+template <typename K, typename M>
+bool operator==(const OffsetMap<K, M> &m1, const OffsetMap<K, M> &m2) {
+    return m1.size() == m2.size() && std::equal(m1.begin(), m1.end(), m2.begin());
+}
+
+template <typename K, typename M>
+bool operator!=(const OffsetMap<K, M> &m1, const OffsetMap<K, M> &m2) {
+    return !(m1 == m2);
+}
+} // namespace cs540
+
+#endif // OFFSET_MAP_HPP
@@ -0,0 +1,236 @@
+#ifndef VERSIONED_MAP_HPP
+#define VERSIONED_MAP_HPP
+
+#include <cstddef>
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "Map.hpp"
+
+namespace cs540 {
+// Map whose entries keep a chain of timestamped values, so reads at a
+// version see the map exactly as it was after that version's write,
+// however many writes have happened since. Erasing leaves a tombstone.
+// Every operation is safe to call concurrently; writers serialize among
+// themselves, but never invalidate what a reader at an older version sees.
+// Values, iterators and pointers read at version v stay valid until
+// gc() is called with a minimum version above v.
+template <typename K, typename M>
+class VersionedMap {
+public:
+    using Version = std::size_t;
+
+private:
+    // The newest version lives inline in the map's node;
+    // older ones hang off it, newest first.
+    struct _Versions {
+        Version version;
+        // Null for a tombstone.
+        std::unique_ptr<const M> value;
+        std::unique_ptr<_Versions> older;
+
+        _Versions() : version{}, value{}, older{} {}
+
+        const _Versions *as_of(Version v) const {
+            auto versions = this;
+            for (; versions && versions->version > v; versions = versions->older.get());
+            return versions;
+        }
+
+        const M *at(Version v) const {
+            auto versions = as_of(v);
+            return versions ? versions->value.get() : nullptr;
+        }
+    };
+    using _Map = Map<K, _Versions>;
+
+    _Map _map;
+    std::size_t _size;
+    std::atomic<Version> _version;
+    mutable std::shared_timed_mutex _mutex;
+
+    // Makes value the newest version of head; the caller holds the lock.
+    Version _push(_Versions &head, std::unique_ptr<const M> value) {
+        if (head.value || head.older) {
+            auto older = std::make_unique<_Versions>(std::move(head));
+            head.older = std::move(older);
+        }
+        _size = _size - (head.older && head.older->value) + (value != nullptr);
+        auto version = _version + 1;
+        head.version = version;
+        head.value = std::move(value);
+        _version = version;
+        return version;
+    }
+
+public:
+    class ConstIterator : public std::iterator<
+        std::forward_iterator_tag,
+        std::pair<const K &, const M &>,
+        std::ptrdiff_t,
+        void,
+        std::pair<const K &, const M &>> {
+        const VersionedMap *_map;
+        typename _Map::ConstIterator _iter;
+        Version _version;
+        const M *_value;
+
+        friend bool operator==(const ConstIterator &i1, const ConstIterator &i2) {
+            return i1._iter == i2._iter;
+        }
+
+        friend bool operator!=(const ConstIterator &i1, const ConstIterator &i2) {
+            return !(i1 == i2);
+        }
+
+        // Skips entries absent at the read version; the caller holds the lock.
+        void _settle() {
+            for (auto end = _map->_map.end(); _iter != end; ++_iter) {
+                _value = _iter->second.at(_version);
+                if (_value) return;
+            }
+            _value = nullptr;
+        }
+
+        ConstIterator(const VersionedMap &map, typename _Map::ConstIterator iter,
+                      Version version) :
+            _map{&map}, _iter{iter}, _version{version}, _value{} {
+            _settle();
+        }
+
+        friend class VersionedMap;
+
+    public:
+        ConstIterator() : _map{}, _iter{}, _version{}, _value{} {}
+
+        ConstIterator &operator++() {
+            std::shared_lock<std::shared_timed_mutex> lock{_map->_mutex};
+            ++_iter;
+            _settle();
+            return *this;
+        }
+
+        ConstIterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        std::pair<const K &, const M &> operator*() const {
+            return {_iter->first, *_value};
+        }
+
+        const K &key() const {
+            return _iter->first;
+        }
+
+        const M &value() const {
+            return *_value;
+        }
+
+        Version version() const {
+            return _version;
+        }
+    }; // class ConstIterator
+
+    VersionedMap() : _map{}, _size{}, _version{}, _mutex{} {}
+
+    VersionedMap(const VersionedMap &) = delete;
+    VersionedMap &operator=(const VersionedMap &) = delete;
+
+    // The newest version whose write has completed.
+    Version version() const {
+        return _version;
+    }
+
+    // Number of entries at the newest version.
+    std::size_t size() const {
+        std::shared_lock<std::shared_timed_mutex> lock{_mutex};
+        return _size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ConstIterator begin(Version v) const {
+        std::shared_lock<std::shared_timed_mutex> lock{_mutex};
+        return {*this, _map.begin(), v};
+    }
+
+    ConstIterator end() const {
+        return {*this, _map.end(), 0};
+    }
+
+    ConstIterator lower_bound(const K &key, Version v) const {
+        std::shared_lock<std::shared_timed_mutex> lock{_mutex};
+        return {*this, _map.lower_bound(key), v};
+    }
+
+    ConstIterator find(const K &key, Version v) const {
+        std::shared_lock<std::shared_timed_mutex> lock{_mutex};
+        auto iter = _map.find(key);
+        if (iter == _map.end() || !iter->second.at(v)) {
+            return end();
+        }
+        return {*this, iter, v};
+    }
+
+    const M &at(const K &key, Version v) const {
+        auto iter = find(key, v);
+        if (iter == end()) {
+            throw std::out_of_range{"Not found"};
+        }
+        return iter.value();
+    }
+
+    // Sets key's value, returning the version the write happened at.
+    Version assign(const K &key, M value) {
+        auto version = std::make_unique<const M>(std::move(value));
+        std::unique_lock<std::shared_timed_mutex> lock{_mutex};
+        return _push(_map[key], std::move(version));
+    }
+
+    // Tombstones key, returning the version the erase happened at.
+    Version erase(const K &key) {
+        std::unique_lock<std::shared_timed_mutex> lock{_mutex};
+        auto iter = _map.find(key);
+        if (iter == _map.end() || !iter->second.value) {
+            throw std::out_of_range{"Not found"};
+        }
+        return _push(iter->second, nullptr);
+    }
+
+    // Drops every version no read at min_version or later can see,
+    // and physically erases entries deleted at or before min_version.
+    void gc(Version min_version) {
+        std::unique_lock<std::shared_timed_mutex> lock{_mutex};
+        for (auto iter = _map.begin(); iter != _map.end();) {
+            auto &head = iter->second;
+            if (head.version <= min_version && !head.value) {
+                _map.erase(iter++);
+                continue;
+            }
+            // Find the version visible at min_version and the one just after.
+            _Versions *newer = nullptr, *visible = &head;
+            for (; visible && visible->version > min_version;
+                newer = visible, visible = visible->older.get());
+            if (visible && visible->value) {
+                visible->older.reset();
+            } else if (visible) {
+                // Reads past min_version find nothing either way.
+                newer->older.reset();
+            }
+            ++iter;
+        }
+    }
+}; // template <typename, typename> class VersionedMap
+} // namespace cs540
+
+#endif // VERSIONED_MAP_HPP
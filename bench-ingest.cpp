@@ -0,0 +1,76 @@
+/*
+ * Sustained ingest into an LsmMap, reporting throughput as runs pile up.
+ *
+ *    bench-ingest [entries [memtable entries]]
+ */
+
+#include "LsmMap.hpp"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+using Milli = std::chrono::duration<double, std::ratio<1,1000>>;
+
+void remove_directory(const std::string &path) {
+    if (auto dir = opendir(path.c_str())) {
+        while (auto entry = readdir(dir)) {
+            std::remove((path + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    long entries = argc > 1 ? std::atol(argv[1]) : 10000000;
+    long memtable = argc > 2 ? std::atol(argv[2]) : 1000000;
+    long report = entries / 20 > 0 ? entries / 20 : 1;
+
+    std::string path{"bench-ingest.lsm"};
+    remove_directory(path);
+    using namespace std::chrono;
+    {
+        cs540::LsmMap<std::uint64_t, std::uint64_t> m{path, static_cast<std::size_t>(memtable)};
+        std::mt19937_64 generator;
+
+        auto start = steady_clock::now(), interval = start;
+        for (long i = 1; i <= entries; ++i) {
+            m.assign(generator(), i);
+            if (i % report == 0) {
+                auto now = steady_clock::now();
+                Milli elapsed = now - interval;
+                std::cout << i << " entries, " << m.runs() << " runs: "
+                          << report / elapsed.count() * 1000 << " inserts/second" << std::endl;
+                interval = now;
+            }
+        }
+        m.flush();
+        Milli total = steady_clock::now() - start;
+        std::cout << "Ingested " << entries << " entries in " << total.count()
+                  << " milliseconds, " << entries / total.count() * 1000
+                  << " inserts/second" << std::endl;
+
+        start = steady_clock::now();
+        m.compact();
+        Milli compaction = steady_clock::now() - start;
+        std::cout << "Compacting took " << compaction.count() << " milliseconds" << std::endl;
+
+        start = steady_clock::now();
+        long scanned = 0;
+        for (auto iter = m.begin(); iter != m.end(); ++iter) {
+            ++scanned;
+        }
+        Milli scan = steady_clock::now() - start;
+        std::cout << "Scanning " << scanned << " entries took " << scan.count()
+                  << " milliseconds" << std::endl;
+    }
+    remove_directory(path);
+}
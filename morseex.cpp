@@ -57,7 +57,7 @@ int main() {
         for (auto c : message) {
             try {
                 std::cout << morse.at(toupper(c)) << '\n';
-            } catch (std::out_of_range) {
+            } catch (const std::out_of_range &) {
                 std::cout << "invalid character: " << c << '\n';
             }
         }
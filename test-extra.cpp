@@ -0,0 +1,300 @@
+#include "LsmMap.hpp"
+#include "Map.hpp"
+#include "OffsetMap.hpp"
+#include "VersionedMap.hpp"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+void snapshots() {
+    cs540::Map<int, std::string> m;
+    for (int i = 0; i < 100; ++i) {
+        m[i] = std::to_string(i);
+    }
+
+    auto s1 = m.snapshot();
+    m.erase(10);
+    m[20] = "twenty";
+    m.at(30) += "!";
+    m.insert({1000, "new"});
+
+    auto s2 = m.snapshot();
+    m.erase(20);
+    m.erase(1000);
+    m[10] = "ten";
+    m.find(40)->second = "forty";
+
+    assert(s1.size() == 100);
+    assert(s2.size() == 100);
+    assert(m.size() == 99);
+
+    assert(s1.at(10) == "10");
+    assert(s1.at(20) == "20");
+    assert(s1.at(30) == "30");
+    assert(s1.at(40) == "40");
+    assert(s1.find(1000) == s1.end());
+
+    assert(s2.find(10) == s2.end());
+    assert(s2.at(20) == "twenty");
+    assert(s2.at(30) == "30!");
+    assert(s2.at(40) == "40");
+    assert(s2.at(1000) == "new");
+
+    int expected = 0;
+    for (auto &value : s1) {
+        assert(value.first == expected);
+        assert(value.second == std::to_string(expected));
+        ++expected;
+    }
+    assert(expected == 100);
+
+    std::size_t count = 0;
+    for (auto iter = s2.begin(); iter != s2.end(); ++iter) {
+        assert(iter->first != 10);
+        ++count;
+    }
+    assert(count == s2.size());
+    assert(s2.lower_bound(10)->first == 11);
+
+    {
+        auto s3 = m.snapshot();
+        m.clear();
+        assert(s3.size() == 99);
+        assert(s3.at(10) == "ten");
+        assert(s3.at(40) == "forty");
+    }
+    assert(s1.at(50) == "50");
+    assert(s2.at(50) == "50");
+    assert(m.empty());
+}
+
+void versioned() {
+    cs540::VersionedMap<int, std::string> m;
+    auto v0 = m.version();
+    auto v1 = m.assign(1, "one");
+    auto v2 = m.assign(2, "two");
+    auto v3 = m.assign(1, "uno");
+    auto v4 = m.erase(2);
+
+    assert(m.find(1, v0) == m.end());
+    assert(m.at(1, v1) == "one");
+    assert(m.at(1, v3) == "uno");
+    assert(m.at(2, v2) == "two");
+    assert(m.find(2, v4) == m.end());
+    assert(m.size() == 1);
+
+    std::vector<int> keys;
+    for (auto iter = m.begin(v2); iter != m.end(); ++iter) {
+        keys.push_back((*iter).first);
+    }
+    assert((keys == std::vector<int>{1, 2}));
+
+    auto &old = m.at(1, v3);
+    m.gc(v3);
+    assert(&m.at(1, v3) == &old);
+    assert(m.at(2, v3) == "two");
+    m.gc(v4);
+    assert(m.find(2, v4) == m.end());
+    assert(m.at(1, v4) == "uno");
+
+    // Readers pin a version while a writer keeps going.
+    for (int i = 0; i < 1000; ++i) {
+        m.assign(i, std::to_string(i));
+    }
+    auto pinned = m.version();
+    std::atomic<bool> done{false};
+    std::thread writer{[&] {
+        for (int round = 0; round < 20; ++round) {
+            for (int i = 0; i < 1000; i += 3) {
+                m.assign(i, "changed");
+            }
+            for (int i = 1000; i < 1100; ++i) {
+                m.assign(i, "new");
+            }
+            for (int i = 1000; i < 1100; ++i) {
+                m.erase(i);
+            }
+        }
+        done = true;
+    }};
+    while (!done) {
+        int expected = 0;
+        for (auto iter = m.begin(pinned); iter != m.end(); ++iter, ++expected) {
+            assert((*iter).first == expected);
+            assert((*iter).second == std::to_string(expected));
+        }
+        assert(expected == 1000);
+    }
+    writer.join();
+    m.gc(m.version());
+    assert(m.size() == 1000);
+    assert(m.at(999, m.version()) == "changed");
+}
+
+void serialization() {
+    cs540::Map<int, double> m;
+    for (int i = 0; i < 100000; ++i) {
+        m.insert({i * 2, i / 2.0});
+    }
+    std::stringstream saved;
+    m.save(saved);
+
+    cs540::Map<int, double> loaded{{-1, 0}};
+    loaded.load(saved);
+    assert(loaded == m);
+    std::stringstream resaved;
+    loaded.save(resaved);
+    assert(resaved.str() == saved.str());
+
+    for (int i = 0; i < 200000; i += 4) {
+        loaded.erase(i);
+    }
+    loaded[1] = 1;
+    assert(loaded.size() == 50001);
+    loaded.clear();
+
+    cs540::Map<std::string, int> words{{"b", 2}, {"a", 1}, {"c", 3}};
+    auto path = std::string{"test-extra.map"};
+    words.save(path);
+    cs540::Map<std::string, int> words_loaded;
+    words_loaded.load(path);
+    std::remove(path.c_str());
+    assert(words_loaded == words);
+
+    bool thrown = false;
+    try {
+        std::stringstream garbage{"not a map at all, not even close"};
+        words_loaded.load(garbage);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(words_loaded.empty());
+}
+
+void offsets() {
+    std::size_t size = 1 << 20;
+    auto region = std::make_unique<std::max_align_t[]>(size / sizeof(std::max_align_t));
+    auto m = cs540::OffsetMap<int, long>::create(region.get(), size);
+    for (int i = 0; i < 10000; ++i) {
+        m.insert({i, i * 10L});
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        m.erase(i);
+    }
+    auto used = m.bytes_used();
+    for (int i = 0; i < 10000; i += 2) {
+        m[i] = i * 10L;
+    }
+    // Erased nodes of the same height get reused.
+    assert(m.bytes_used() - used < used / 4);
+    m.erase(5000);
+    assert(m.size() == 9999);
+
+    // Move the bytes somewhere else and open them there.
+    auto moved = std::make_unique<std::max_align_t[]>(size / sizeof(std::max_align_t));
+    std::memcpy(moved.get(), region.get(), size);
+    region.reset();
+    const void *read_only = moved.get();
+    auto reopened = cs540::OffsetMap<int, long>::open(read_only, size);
+    assert(reopened.size() == 9999);
+    assert(reopened.at(9999) == 99990);
+    assert(reopened.find(5000) == reopened.end());
+    assert(reopened.lower_bound(5000)->first == 5001);
+    int expected = 0;
+    for (auto &value : reopened) {
+        if (expected == 5000) ++expected;
+        assert(value.first == expected && value.second == expected * 10L);
+        ++expected;
+    }
+    assert((--reopened.end())->first == 9999);
+
+    bool thrown = false;
+    try {
+        cs540::OffsetMap<int, int>::open(read_only, size);
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void remove_directory(const std::string &path) {
+    if (auto dir = opendir(path.c_str())) {
+        while (auto entry = readdir(dir)) {
+            std::remove((path + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+void lsm() {
+    std::string path{"test-extra.lsm"};
+    remove_directory(path);
+    {
+        cs540::LsmMap<int, std::string> m{path, 100};
+        for (int i = 0; i < 1000; ++i) {
+            m.assign(i, std::to_string(i));
+        }
+        for (int i = 0; i < 1000; i += 3) {
+            m.erase(i);
+        }
+        for (int i = 0; i < 1000; i += 5) {
+            m.assign(i, "five");
+        }
+        assert(m.runs() > 10);
+        assert(m.at(10) == "five");
+        assert(m.at(7) == "7");
+        bool thrown = false;
+        try {
+            m.at(3);
+        } catch (const std::out_of_range &) {
+            thrown = true;
+        }
+        assert(thrown);
+        m.flush();
+    }
+
+    cs540::LsmMap<int, std::string> m{path, 100};
+    auto check = [&] {
+        int count = 0, last = -1;
+        for (auto iter = m.begin(); iter != m.end(); ++iter) {
+            auto key = (*iter).first;
+            assert(key > last);
+            assert(key % 5 == 0 || key % 3 != 0);
+            assert((*iter).second == (key % 5 == 0 ? "five" : std::to_string(key)));
+            last = key;
+            ++count;
+        }
+        assert(count == 1000 - 334 + 67);
+        assert((*m.lower_bound(298)).first == 298);
+        assert((*m.lower_bound(297)).first == 298);
+        assert(m.at(999 - 2) == "997");
+    };
+    check();
+    m.compact();
+    assert(m.runs() == 1);
+    check();
+    remove_directory(path);
+}
+
+int main() {
+    snapshots();
+    versioned();
+    serialization();
+    offsets();
+    lsm();
+    return 0;
+}
@@ -47,7 +47,7 @@ void access_by_key() {
     bool thrown = false;
     try {
         m.at(10000);
-    } catch (std::out_of_range) {
+    } catch (const std::out_of_range &) {
         thrown = true;
     }
     assert(thrown); // the .at should have thrown an exception
@@ -118,7 +118,7 @@ int main () {
     const int n = 30;
     try {
         std::cout << cube.at(n) << '\n'; // 30 is not in the Map
-    } catch (std::out_of_range) {
+    } catch (const std::out_of_range &) {
         std::cout << n << " not in cubes range\n";
     }
 